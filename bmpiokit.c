@@ -4,14 +4,17 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 #include <mach/mach.h>
 #include <IOKit/IOTypes.h>
 #include <IOKit/IOCFBundle.h>
 #include <IOKit/usb/IOUSBLib.h>
 #include <IOKit/IOCFPlugIn.h>
+#include <IOKit/serial/IOSerialKeys.h>
 
 #include "unicode.h"
 
@@ -20,7 +23,22 @@ static uint16_t bmdPID = 0x6018U;
 
 #define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
 
-mach_port_t openIOKitInterface(void)
+// The longest a string descriptor can be in UTF-16 code units, given its 1 byte length field and 2 byte header
+#define MAX_STRING_DESCRIPTOR_UNITS 126U
+// Enough storage for the longest string descriptor in UTF-8 (at most 3 bytes per code unit) plus a NUL terminator
+#define MAX_STRING_LENGTH ((MAX_STRING_DESCRIPTOR_UNITS * 3U) + 1U)
+// Enough storage for the path to a serial port device node plus a NUL terminator
+#define MAX_PATH_LENGTH 128U
+
+// The first interface of the CDC ACM interface pairs for the probe's GDB server and target UART
+#define BMP_GDB_INTERFACE 0U
+#define BMP_UART_INTERFACE 2U
+// The interface carrying the probe's SWO trace stream
+#define BMP_TRACE_INTERFACE 5U
+// How long in seconds to wait for the drivers for a newly plugged in probe's interfaces to attach
+#define PORT_SETTLE_TIMEOUT 2U
+
+static mach_port_t openIOKitInterface(void)
 {
 	mach_port_t ioKitPort = MACH_PORT_NULL;
 	const kern_return_t result = IOMainPort(MACH_PORT_NULL, &ioKitPort);
@@ -32,7 +50,7 @@ mach_port_t openIOKitInterface(void)
 	return ioKitPort;
 }
 
-CFMutableDictionaryRef buildBMPMatchingDict(void)
+static CFMutableDictionaryRef buildBMPMatchingDict(void)
 {
 	// Start by creating a new dictionary for matching on the IOKit IOUSBDevice base class
 	CFMutableDictionaryRef dict = IOServiceMatching(kIOUSBDeviceClassName);
@@ -49,7 +67,7 @@ CFMutableDictionaryRef buildBMPMatchingDict(void)
 	return dict;
 }
 
-io_iterator_t discoverProbes(const mach_port_t ioKitPort)
+static io_iterator_t discoverProbes(const mach_port_t ioKitPort)
 {
 	// Next, set up the device matching dictionary to find BMPs with
 	const CFMutableDictionaryRef deviceMatchingDict = buildBMPMatchingDict();
@@ -69,7 +87,7 @@ io_iterator_t discoverProbes(const mach_port_t ioKitPort)
 	return matches;
 }
 
-IOUSBDeviceInterface **openDevice(const io_service_t usbDeviceService)
+static IOUSBDeviceInterface **openDevice(const io_service_t usbDeviceService)
 {
 	// Check that the service is valid
 	if (usbDeviceService == MACH_PORT_NULL)
@@ -81,8 +99,6 @@ IOUSBDeviceInterface **openDevice(const io_service_t usbDeviceService)
 		SInt32 score; // XXX: No idea what this is/does - does it matter? Can we skip it? etc.. fruitco doesn't document it.
 		const kern_return_t result = IOCreatePlugInInterfaceForService(usbDeviceService,
 			kIOUSBDeviceUserClientTypeID, kIOCFPlugInInterfaceID, &pluginInterface, &score);
-		// Clean up now we're done with the device
-		IOObjectRelease(usbDeviceService);
 		// Check how we got on, bailing if anything went wrong
 		if (result != kIOReturnSuccess || pluginInterface == NULL)
 		{
@@ -107,13 +123,13 @@ IOUSBDeviceInterface **openDevice(const io_service_t usbDeviceService)
 	return deviceInterface;
 }
 
-void checkResult(const IOReturn result, const char *const action)
+static void checkResult(const IOReturn result, const char *const action)
 {
 	if (result != kIOReturnSuccess)
 		printf("Error while %s (%08x): %s\n", action, result, mach_error_string(result));
 }
 
-size_t requestStringLength(IOUSBDeviceInterface **const usbDevice, const uint8_t index)
+static size_t requestStringLength(IOUSBDeviceInterface **const usbDevice, const uint8_t index)
 {
 	// Request just the first couple of bytes of the descriptor to validate and grab the length byte from
 	IOUSBDescriptorHeader header = {0U};
@@ -140,10 +156,10 @@ size_t requestStringLength(IOUSBDeviceInterface **const usbDevice, const uint8_t
 	return (header.bLength - 2U) / 2U;
 }
 
-IOReturn requestStringDescriptor(IOUSBDeviceInterface **const usbDevice, const uint8_t index, char16_t *const string, const size_t length)
+static IOReturn requestStringDescriptor(IOUSBDeviceInterface **const usbDevice, const uint8_t index, char16_t *const string, const size_t length)
 {
 	// Check that the string length isn't too long, and bail if it is
-	if (length > 127U)
+	if (length > MAX_STRING_DESCRIPTOR_UNITS)
 		return kIOReturnBadArgument;
 	uint8_t data[256U] = {0U};
 	IOUSBDevRequestTO request =
@@ -172,56 +188,631 @@ IOReturn requestStringDescriptor(IOUSBDeviceInterface **const usbDevice, const u
 	return kIOReturnSuccess;
 }
 
-char *requestStringFromDevice(IOUSBDeviceInterface **const usbDevice, const uint8_t index)
+static void requestStringFromDevice(IOUSBDeviceInterface **const usbDevice, const uint8_t index, char *const string,
+	const size_t length)
 {
 	// If the string index is invalid (points at the language descriptor), translate it to a known unknown string
 	if (index == 0U)
-		return strdup("---");
+	{
+		strncpy(string, "---", length);
+		return;
+	}
 
 	// Otherwise, ask the device how long the string actually is
-	const size_t length = requestStringLength(usbDevice, index);
-	if (length == 0U)
+	const size_t utf16Length = requestStringLength(usbDevice, index);
+	if (utf16Length == 0U)
 	{
 		// We failed to get the string's length for some reason, so display an error and turn it into the known unknown string
 		printf("Failed to retreive string length for string descriptor %u\n", index);
-		return strdup("---");
-	}
-
-	// Next, allocate enough storage for the UTF-16 version of the string, including a NUL terminator on the end
-	char16_t *utf16String = calloc(sizeof(char16_t), length + 1U);
-	if (utf16String == NULL)
-	{
-		// If that didn't work, fail more violently as we OOM'd
-		printf("Failed to allocate storage for string from string descriptor %u\n", index);
-		return NULL;
+		strncpy(string, "---", length);
+		return;
 	}
 
-	// Now extract the string itself
-	const IOReturn result = requestStringDescriptor(usbDevice, index, utf16String, length);
+	// Now extract the string itself into enough storage for the longest possible string plus a NUL terminator
+	char16_t utf16String[MAX_STRING_DESCRIPTOR_UNITS + 1U] = {0U};
+	const IOReturn result = requestStringDescriptor(usbDevice, index, utf16String, utf16Length);
 	if (result != kIOReturnSuccess)
 	{
 		// That failed somehow - display it and translate to the known unknown string
-		free(utf16String);
 		printf("Failed to retreive string descriptor %u (%08x): %s\n", index, result, mach_error_string(result));
-		return strdup("---");
+		strncpy(string, "---", length);
+		return;
+	}
+
+	// Convert the UTF-16 string descriptor string to UTF-8 in the caller's storage
+	if (!utf8FromUtf16Buffer(utf16String, utf16Length + 1U, string, length))
+	{
+		// The device handed back malformed UTF-16 - display that and translate to the known unknown string
+		printf("Invalid UTF-16 in string descriptor %u\n", index);
+		strncpy(string, "---", length);
+	}
+}
+
+static bool requestNumberFromRegistry(const io_service_t usbDeviceService, const CFStringRef property, const CFNumberType type,
+	void *const value)
+{
+	// Ask IOKit for the copy of the property it cached when it enumerated the device
+	const CFTypeRef number = IORegistryEntryCreateCFProperty(usbDeviceService, property, kCFAllocatorDefault, 0U);
+	if (number == NULL)
+		return false;
+	// Check that it's actually a number before trying to unpack it, then clean up
+	const bool result = CFGetTypeID(number) == CFNumberGetTypeID() && CFNumberGetValue((CFNumberRef)number, type, value);
+	CFRelease(number);
+	return result;
+}
+
+static bool requestStringFromRegistry(const io_service_t usbDeviceService, const CFStringRef property,
+	char *const string, const size_t length)
+{
+	// Ask IOKit for the copy of the string it read from the device when it enumerated the device
+	const CFTypeRef value = IORegistryEntryCreateCFProperty(usbDeviceService, property, kCFAllocatorDefault, 0U);
+	if (value == NULL)
+		return false;
+	// Check that we actually got a string back, and if we did convert it to UTF-8 in the caller's storage
+	const bool result = CFGetTypeID(value) == CFStringGetTypeID() &&
+		CFStringGetCString((CFStringRef)value, string, (CFIndex)length, kCFStringEncodingUTF8);
+	CFRelease(value);
+	// Make sure a failed conversion leaves the string marked as missing
+	if (!result)
+		string[0U] = '\0';
+	return result;
+}
+
+static bool missingString(const char *const string)
+{
+	// A string is only missing if we want it (have storage for it) and don't yet have it
+	return string != NULL && string[0U] == '\0';
+}
+
+static void requestMissingStrings(const io_service_t usbDeviceService, USBDeviceAddress *const busAddress,
+	char *const manufacturer, char *const product, char *const serialNumber)
+{
+	// If IOKit already had everything we need cached, there's nothing to do - this keeps us off the bus entirely
+	const bool needAddress = busAddress != NULL && *busAddress == 0U;
+	const bool needStrings = missingString(manufacturer) || missingString(product) || missingString(serialNumber);
+	if (!needAddress && !needStrings)
+		return;
+
+	// Otherwise we have to talk to the device, so get an interface to it
+	IOUSBDeviceInterface **const usbDevice = openDevice(usbDeviceService);
+	if (usbDevice == NULL)
+		return;
+
+	// Get the device's address information if we need it
+	if (needAddress)
+		checkResult((*usbDevice)->GetDeviceAddress(usbDevice, busAddress), "grabbing device address");
+
+	if (needStrings)
+	{
+		// Get the device's string descriptor indexes
+		uint8_t manufacturerStringIndex;
+		checkResult((*usbDevice)->USBGetManufacturerStringIndex(usbDevice, &manufacturerStringIndex), "grabbing manufacturer string index");
+		uint8_t productStringIndex;
+		checkResult((*usbDevice)->USBGetProductStringIndex(usbDevice, &productStringIndex), "grabbing product string index");
+		uint8_t serialNumberStringIndex;
+		checkResult((*usbDevice)->USBGetSerialNumberStringIndex(usbDevice, &serialNumberStringIndex), "grabbing serial number string index");
+
+		// Open the device so we can make a few requests
+		checkResult((*usbDevice)->USBDeviceOpen(usbDevice), "opening USB device");
+
+		// Now extract only the strings IOKit didn't have for us so we can display a nice entry for the device
+		if (missingString(manufacturer))
+			requestStringFromDevice(usbDevice, manufacturerStringIndex, manufacturer, MAX_STRING_LENGTH);
+		if (missingString(product))
+			requestStringFromDevice(usbDevice, productStringIndex, product, MAX_STRING_LENGTH);
+		if (missingString(serialNumber))
+			requestStringFromDevice(usbDevice, serialNumberStringIndex, serialNumber, MAX_STRING_LENGTH);
+
+		// Now we're done with the requests, close the device again
+		checkResult((*usbDevice)->USBDeviceClose(usbDevice), "closing USB device");
+	}
+	(*usbDevice)->Release(usbDevice);
+}
+
+static io_registry_entry_t findEntryBelow(const io_service_t usbDeviceService,
+	bool (*const matches)(io_registry_entry_t entry, uint32_t interfaceNumber), const uint32_t interfaceNumber)
+{
+	// Walk everything IOKit has attached below the device, looking for the first entry that matches
+	io_iterator_t iterator = MACH_PORT_NULL;
+	if (IORegistryEntryCreateIterator(usbDeviceService, kIOServicePlane, kIORegistryIterateRecursively, &iterator) !=
+		KERN_SUCCESS)
+		return MACH_PORT_NULL;
+
+	io_registry_entry_t entry = IOIteratorNext(iterator);
+	for (; entry != MACH_PORT_NULL; entry = IOIteratorNext(iterator))
+	{
+		// Hand a match back to the caller, who is then responsible for releasing it
+		if (matches(entry, interfaceNumber))
+			break;
+		IOObjectRelease(entry);
+	}
+	IOObjectRelease(iterator);
+	return entry;
+}
+
+static bool isSerialPortFor(const io_registry_entry_t entry, const uint32_t interfaceNumber)
+{
+	if (!IOObjectConformsTo(entry, kIOSerialBSDServiceValue))
+		return false;
+	// Find out which of the device's interfaces the port hangs off of by searching back up the tree
+	uint32_t portInterface = UINT32_MAX;
+	const CFTypeRef number = IORegistryEntrySearchCFProperty(entry, kIOServicePlane, CFSTR(kUSBInterfaceNumber),
+		kCFAllocatorDefault, kIORegistryIterateRecursively | kIORegistryIterateParents);
+	if (number != NULL)
+	{
+		if (CFGetTypeID(number) == CFNumberGetTypeID())
+			CFNumberGetValue((CFNumberRef)number, kCFNumberSInt32Type, &portInterface);
+		CFRelease(number);
+	}
+	// CDC ACM ports are an interface pair (control then data), and the port can hang off either
+	return (portInterface & ~1U) == interfaceNumber;
+}
+
+static bool isInterface(const io_registry_entry_t entry, const uint32_t interfaceNumber)
+{
+	// Only interfaces carry an interface number directly, so this is enough to tell if we found it
+	uint32_t entryInterface = UINT32_MAX;
+	return requestNumberFromRegistry(entry, CFSTR(kUSBInterfaceNumber), kCFNumberSInt32Type, &entryInterface) &&
+		entryInterface == interfaceNumber;
+}
+
+static bool requestSerialPort(const io_service_t usbDeviceService, const uint32_t interfaceNumber, char *const path,
+	const size_t length)
+{
+	// Find the serial port node for the interface, and ask it for the path to its callout device
+	const io_registry_entry_t port = findEntryBelow(usbDeviceService, isSerialPortFor, interfaceNumber);
+	if (port == MACH_PORT_NULL)
+		return false;
+	const bool found = requestStringFromRegistry(port, CFSTR(kIOCalloutDeviceKey), path, length);
+	IOObjectRelease(port);
+	return found;
+}
+
+static bool requestInterface(const io_service_t usbDeviceService, const uint32_t interfaceNumber)
+{
+	const io_registry_entry_t entry = findEntryBelow(usbDeviceService, isInterface, interfaceNumber);
+	if (entry == MACH_PORT_NULL)
+		return false;
+	IOObjectRelease(entry);
+	return true;
+}
+
+// The most serial numbers that can be asked for at once
+#define MAX_SERIAL_QUERIES 64U
+
+typedef struct probeQuery
+{
+	// The serial numbers of the probes to display, or none to display every probe
+	const char *serials[MAX_SERIAL_QUERIES];
+	// Which of those we've found so far
+	bool found[MAX_SERIAL_QUERIES];
+	size_t count;
+	size_t remaining;
+} probeQuery_s;
+
+static bool querySerial(const probeQuery_s *const query, const char *const serialNumber)
+{
+	// If no serial numbers were asked for, every probe matches
+	if (query->count == 0U)
+		return true;
+	for (size_t index = 0U; index < query->count; ++index)
+	{
+		if (strcmp(query->serials[index], serialNumber) == 0)
+			return true;
+	}
+	return false;
+}
+
+static void markSerialFound(probeQuery_s *const query, const char *const serialNumber)
+{
+	// Mark every entry for this serial number as found, which copes with the same one being asked for twice
+	for (size_t index = 0U; index < query->count; ++index)
+	{
+		if (!query->found[index] && strcmp(query->serials[index], serialNumber) == 0)
+		{
+			query->found[index] = true;
+			--query->remaining;
+		}
 	}
+}
 
-	// Convert the UTF-16 string descriptor string to UTF-8, then clean up and return it
-	char *utf8String = utf8FromUtf16(utf16String, length + 1U);
-	free(utf16String);
-	return utf8String;
+typedef enum probeField
+{
+	FIELD_PRODUCT,
+	FIELD_MANUFACTURER,
+	FIELD_SERIAL,
+	FIELD_ADDRESS,
+	FIELD_LOCATION,
+	FIELD_ID,
+	FIELD_GDB_PORT,
+	FIELD_UART_PORT,
+	FIELD_TRACE,
+	FIELD_COUNT,
+} probeField_e;
+
+#define FIELD(field) (1U << (field))
+
+static const char *const fieldNames[FIELD_COUNT] =
+{
+	"product",
+	"manufacturer",
+	"serial",
+	"address",
+	"location",
+	"id",
+	"gdb",
+	"uart",
+	"trace",
+};
+
+typedef struct probeFields
+{
+	// The fields to display in the order to display them, or none for the default descriptive output
+	probeField_e order[FIELD_COUNT];
+	size_t count;
+	// Which fields are needed to generate the output, as a mask of FIELD() bits
+	uint32_t needed;
+} probeFields_s;
+
+static bool parseFields(const char *list, probeFields_s *const fields)
+{
+	fields->count = 0U;
+	fields->needed = 0U;
+	while (*list != '\0')
+	{
+		// Find how long the next field name in the list is
+		const char *const end = strchr(list, ',');
+		const size_t length = end != NULL ? (size_t)(end - list) : strlen(list);
+		// Look the name up, bailing if it's not a field we know or we've run out of space
+		size_t field = 0U;
+		while (field < FIELD_COUNT && (strlen(fieldNames[field]) != length || strncmp(list, fieldNames[field], length) != 0))
+			++field;
+		if (field == FIELD_COUNT || fields->count == FIELD_COUNT)
+			return false;
+		fields->order[fields->count++] = (probeField_e)field;
+		fields->needed |= FIELD(field);
+		// Move on to the next field name
+		list += length;
+		if (*list == ',')
+			++list;
+	}
+	return fields->count != 0U;
+}
+
+typedef enum probeStatus
+{
+	PROBE_SKIPPED,
+	PROBE_FAILED,
+	PROBE_DISPLAYED,
+} probeStatus_e;
+
+typedef struct probeInfo
+{
+	uint16_t vid;
+	uint16_t pid;
+	USBDeviceAddress busAddress;
+	uint32_t locationID;
+	bool haveLocationID;
+	char manufacturer[MAX_STRING_LENGTH];
+	char product[MAX_STRING_LENGTH];
+	char serialNumber[MAX_STRING_LENGTH];
+	char gdbPort[MAX_PATH_LENGTH];
+	bool haveGDBPort;
+	char uartPort[MAX_PATH_LENGTH];
+	bool haveUARTPort;
+	bool haveTrace;
+	// Set when watch mode gave up waiting for the probe's drivers, so missing ports may just not be there yet
+	bool driversTimedOut;
+} probeInfo_s;
+
+static void requestProbeFromRegistry(const io_service_t usbDeviceService, const uint32_t needed,
+	probeInfo_s *const probe)
+{
+	// Pull the device's address, location and strings from the copies IOKit cached when the device was enumerated,
+	// so that we don't have to generate any bus traffic to a probe that might be in the middle of a debug session
+	if (needed & FIELD(FIELD_ADDRESS))
+		requestNumberFromRegistry(usbDeviceService, CFSTR(kUSBDevicePropertyAddress), kCFNumberSInt16Type,
+			&probe->busAddress);
+	probe->haveLocationID = (needed & FIELD(FIELD_LOCATION)) && requestNumberFromRegistry(usbDeviceService,
+		CFSTR(kUSBDevicePropertyLocationID), kCFNumberSInt32Type, &probe->locationID);
+	if (needed & FIELD(FIELD_MANUFACTURER))
+		requestStringFromRegistry(usbDeviceService, CFSTR(kUSBVendorString), probe->manufacturer, MAX_STRING_LENGTH);
+	if (needed & FIELD(FIELD_PRODUCT))
+		requestStringFromRegistry(usbDeviceService, CFSTR(kUSBProductString), probe->product, MAX_STRING_LENGTH);
+}
+
+static const char *missingInterface(const probeInfo_s *const probe)
+{
+	// Distinguish an interface the probe doesn't have from one whose driver hadn't attached when we gave up waiting
+	return probe->driversTimedOut ? "timeout" : "---";
+}
+
+static void displayFields(const char *const event, const probeFields_s *const fields, const probeInfo_s *const probe)
+{
+	// If this is a watch mode event, say what happened to the probe first so the two kinds of record can be told apart
+	if (event != NULL)
+		printf("%s\t", event);
+	// Display just the requested fields, tab separated, in the order they were asked for
+	for (size_t index = 0U; index < fields->count; ++index)
+	{
+		if (index)
+			putchar('\t');
+		switch (fields->order[index])
+		{
+			case FIELD_PRODUCT:
+				printf("%s", probe->product[0U] != '\0' ? probe->product : "---");
+				break;
+			case FIELD_MANUFACTURER:
+				printf("%s", probe->manufacturer[0U] != '\0' ? probe->manufacturer : "---");
+				break;
+			case FIELD_SERIAL:
+				printf("%s", probe->serialNumber[0U] != '\0' ? probe->serialNumber : "---");
+				break;
+			case FIELD_ADDRESS:
+				printf("%u", probe->busAddress);
+				break;
+			case FIELD_LOCATION:
+				if (probe->haveLocationID)
+					printf("0x%08" PRIx32, probe->locationID);
+				else
+					printf("---");
+				break;
+			case FIELD_ID:
+				printf("%04x:%04x", probe->vid, probe->pid);
+				break;
+			case FIELD_GDB_PORT:
+				printf("%s", probe->haveGDBPort ? probe->gdbPort : missingInterface(probe));
+				break;
+			case FIELD_UART_PORT:
+				printf("%s", probe->haveUARTPort ? probe->uartPort : missingInterface(probe));
+				break;
+			case FIELD_TRACE:
+				if (probe->haveTrace)
+					printf("%u", BMP_TRACE_INTERFACE);
+				else
+					printf("%s", missingInterface(probe));
+				break;
+			case FIELD_COUNT:
+				break;
+		}
+	}
+	putchar('\n');
+}
+
+static probeStatus_e displayProbe(const io_service_t usbDeviceService, probeQuery_s *const query,
+	const probeFields_s *const fields, const char *const event, const bool driversTimedOut)
+{
+	probeInfo_s probe = {.vid = 0U, .driversTimedOut = driversTimedOut};
+	// Check that the VID:PID for the device are correct
+	requestNumberFromRegistry(usbDeviceService, CFSTR(kUSBVendorID), kCFNumberSInt16Type, &probe.vid);
+	requestNumberFromRegistry(usbDeviceService, CFSTR(kUSBProductID), kCFNumberSInt16Type, &probe.pid);
+	if (probe.vid != bmdVID || probe.pid != bmdPID)
+	{
+		// Release the device and go to the next one
+		IOObjectRelease(usbDeviceService);
+		return PROBE_FAILED;
+	}
+
+	// Only fetch what the output actually needs, starting with the serial number from the registry
+	const uint32_t needed = fields->needed;
+	const bool needSerialNumber = query->count != 0U || (needed & FIELD(FIELD_SERIAL));
+	const bool haveSerialNumber = needSerialNumber && requestStringFromRegistry(usbDeviceService,
+		CFSTR(kUSBSerialNumberString), probe.serialNumber, MAX_STRING_LENGTH);
+	// If we're looking for specific probes and this isn't one of them, skip it before doing any more work on it
+	if (haveSerialNumber && !querySerial(query, probe.serialNumber))
+	{
+		IOObjectRelease(usbDeviceService);
+		return PROBE_SKIPPED;
+	}
+	requestProbeFromRegistry(usbDeviceService, needed, &probe);
+	// Fall back to asking the device for anything IOKit didn't have
+	requestMissingStrings(usbDeviceService, (needed & FIELD(FIELD_ADDRESS)) ? &probe.busAddress : NULL,
+		(needed & FIELD(FIELD_MANUFACTURER)) ? probe.manufacturer : NULL,
+		(needed & FIELD(FIELD_PRODUCT)) ? probe.product : NULL, needSerialNumber ? probe.serialNumber : NULL);
+	// Find where each of the probe's streams can be got at so the user knows where to capture them from
+	probe.haveGDBPort = (needed & FIELD(FIELD_GDB_PORT)) &&
+		requestSerialPort(usbDeviceService, BMP_GDB_INTERFACE, probe.gdbPort, MAX_PATH_LENGTH);
+	probe.haveUARTPort = (needed & FIELD(FIELD_UART_PORT)) &&
+		requestSerialPort(usbDeviceService, BMP_UART_INTERFACE, probe.uartPort, MAX_PATH_LENGTH);
+	probe.haveTrace = (needed & FIELD(FIELD_TRACE)) && requestInterface(usbDeviceService, BMP_TRACE_INTERFACE);
+	// Clean up now we're done with the device
+	IOObjectRelease(usbDeviceService);
+
+	// Check if we managed to get something for each of the strings we need, or if an error occured
+	if (((needed & FIELD(FIELD_MANUFACTURER)) && probe.manufacturer[0U] == '\0') ||
+		((needed & FIELD(FIELD_PRODUCT)) && probe.product[0U] == '\0') ||
+		(needSerialNumber && probe.serialNumber[0U] == '\0'))
+	{
+		printf("Failed to retreive one of the string descriptors for the device at address %u\n", probe.busAddress);
+		return PROBE_FAILED;
+	}
+
+	// Check the serial number again in case it had to come from the device itself
+	if (!querySerial(query, probe.serialNumber))
+		return PROBE_SKIPPED;
+	markSerialFound(query, probe.serialNumber);
+
+	// If fields were asked for, display just those
+	if (fields->count != 0U)
+	{
+		displayFields(event, fields, &probe);
+		return PROBE_DISPLAYED;
+	}
+
+	// Otherwise display the default descriptive entry for the probe
+	printf("Found %s (%s) w/ serial %s at address %u\n", probe.product, probe.manufacturer, probe.serialNumber,
+		probe.busAddress);
+	if (probe.haveGDBPort)
+		printf("\tGDB server on %s\n", probe.gdbPort);
+	if (probe.haveUARTPort)
+		printf("\tTarget UART on %s\n", probe.uartPort);
+	if (probe.haveTrace)
+		printf("\tSWO trace on interface %u\n", BMP_TRACE_INTERFACE);
+	if (probe.driversTimedOut)
+		printf("\tTimed out waiting for the probe's drivers to attach, some interfaces may be missing\n");
+	return PROBE_DISPLAYED;
+}
+
+typedef struct watchState
+{
+	probeQuery_s *query;
+	const probeFields_s *fields;
+} watchState_s;
+
+static void probesArrived(void *const context, const io_iterator_t iterator)
+{
+	const watchState_s *const state = (const watchState_s *)context;
+	// Display each of the newly arrived probes - draining the iterator also re-arms the notification
+	for (io_service_t usbDeviceService = IOIteratorNext(iterator); usbDeviceService != MACH_PORT_NULL;
+		usbDeviceService = IOIteratorNext(iterator))
+	{
+		// We get told about the device as soon as it registers, before the CDC ACM drivers and their serial port
+		// nodes attach, so give IOKit a moment to finish matching drivers under it before looking for its ports
+		mach_timespec_t timeout = {.tv_sec = PORT_SETTLE_TIMEOUT, .tv_nsec = 0};
+		const IOReturn result = IOServiceWaitQuiet(usbDeviceService, &timeout);
+		// If they still hadn't all attached by then, display what we have and flag it on the probe's record
+		if (result != kIOReturnTimeout)
+			checkResult(result, "waiting for the probe's drivers to attach");
+		displayProbe(usbDeviceService, state->query, state->fields, "found", result == kIOReturnTimeout);
+	}
+	fflush(stdout);
+}
+
+static void probesRemoved(void *const context, const io_iterator_t iterator)
+{
+	const watchState_s *const state = (const watchState_s *)context;
+	for (io_service_t usbDeviceService = IOIteratorNext(iterator); usbDeviceService != MACH_PORT_NULL;
+		usbDeviceService = IOIteratorNext(iterator))
+	{
+		// The device is gone so the registry is all we have left to identify it by, and its ports are gone with it
+		probeInfo_s probe = {.vid = bmdVID, .pid = bmdPID};
+		const bool haveSerialNumber = requestStringFromRegistry(usbDeviceService, CFSTR(kUSBSerialNumberString),
+			probe.serialNumber, MAX_STRING_LENGTH);
+		requestProbeFromRegistry(usbDeviceService, state->fields->needed | FIELD(FIELD_ADDRESS), &probe);
+		IOObjectRelease(usbDeviceService);
+
+		if (state->query->count != 0U && !(haveSerialNumber && querySerial(state->query, probe.serialNumber)))
+			continue;
+		if (state->fields->count != 0U)
+			displayFields("lost", state->fields, &probe);
+		else
+			printf("Lost BMP w/ serial %s at address %u\n", haveSerialNumber ? probe.serialNumber : "---",
+				probe.busAddress);
+	}
+	fflush(stdout);
+}
+
+static int watchProbes(const mach_port_t ioKitPort, watchState_s *const state)
+{
+	// Set up a notification port to receive hotplug events on and hook it into this thread's run loop
+	const IONotificationPortRef notificationPort = IONotificationPortCreate(ioKitPort);
+	if (notificationPort == NULL)
+	{
+		printf("Failed to create IOKit notification port\n");
+		return 1;
+	}
+	CFRunLoopAddSource(CFRunLoopGetCurrent(), IONotificationPortGetRunLoopSource(notificationPort),
+		kCFRunLoopDefaultMode);
+
+	// Ask to be told about BMPs arriving and leaving the system (NB, these calls consume the matching dictionaries)
+	io_iterator_t arrivalIterator = MACH_PORT_NULL;
+	io_iterator_t removalIterator = MACH_PORT_NULL;
+	const CFMutableDictionaryRef arrivalMatchingDict = buildBMPMatchingDict();
+	const CFMutableDictionaryRef removalMatchingDict = buildBMPMatchingDict();
+	if (arrivalMatchingDict == NULL || removalMatchingDict == NULL ||
+		IOServiceAddMatchingNotification(notificationPort, kIOFirstMatchNotification, arrivalMatchingDict,
+			probesArrived, state, &arrivalIterator) != KERN_SUCCESS ||
+		IOServiceAddMatchingNotification(notificationPort, kIOTerminatedNotification, removalMatchingDict,
+			probesRemoved, state, &removalIterator) != KERN_SUCCESS)
+	{
+		printf("Failed to register for BMP hotplug notifications\n");
+		IONotificationPortDestroy(notificationPort);
+		return 1;
+	}
+
+	// Drain both iterators - this displays the probes already on the system and arms the notifications
+	probesArrived(state, arrivalIterator);
+	probesRemoved(state, removalIterator);
+
+	// Now wait for things to change, only ever looking at the probes that did
+	CFRunLoopRun();
+	IOObjectRelease(arrivalIterator);
+	IOObjectRelease(removalIterator);
+	IONotificationPortDestroy(notificationPort);
+	return 0;
+}
+
+static void displayUsage(const char *const program)
+{
+	printf("Usage: %s [-w|--watch] [-f|--fields list] [serial...]\n", program);
+	printf("\t-w, --watch          Keep running, displaying probes as they are plugged in and removed\n");
+	printf("\t-f, --fields list    Display only these comma separated fields for each probe, one probe per line:\n");
+	printf("\t                    ");
+	for (size_t field = 0U; field < FIELD_COUNT; ++field)
+		printf(" %s", fieldNames[field]);
+	printf("\n");
+	printf("\t                     (with --watch, each line starts with \"found\" or \"lost\" and a tab)\n");
+	printf("\t                     (with --watch, port and trace fields read \"timeout\" if the drivers were slow)\n");
+	printf("\tserial               Only display the probes with these serial numbers\n");
 }
 
 int main(int argc, char **argv)
 {
-	(void)argc;
-	(void)argv;
+	// Parse the command line - if we were given serial numbers, we're answering "where are these probes"
+	// rather than listing every probe
+	bool watch = false;
+	probeQuery_s query = {.count = 0U};
+	// By default, we display a descriptive entry for each probe
+	probeFields_s fields =
+	{
+		.count = 0U,
+		.needed = FIELD(FIELD_PRODUCT) | FIELD(FIELD_MANUFACTURER) | FIELD(FIELD_SERIAL) | FIELD(FIELD_ADDRESS) |
+			FIELD(FIELD_GDB_PORT) | FIELD(FIELD_UART_PORT) | FIELD(FIELD_TRACE),
+	};
+	for (int arg = 1; arg < argc; ++arg)
+	{
+		if (strcmp(argv[arg], "-w") == 0 || strcmp(argv[arg], "--watch") == 0)
+			watch = true;
+		else if ((strcmp(argv[arg], "-f") == 0 || strcmp(argv[arg], "--fields") == 0) && arg + 1 < argc)
+		{
+			if (!parseFields(argv[++arg], &fields))
+			{
+				displayUsage(argv[0]);
+				return 1;
+			}
+		}
+		else if (argv[arg][0] != '-')
+		{
+			if (query.count == MAX_SERIAL_QUERIES)
+			{
+				printf("Too many serial numbers given (max %u)\n", MAX_SERIAL_QUERIES);
+				return 1;
+			}
+			query.serials[query.count++] = argv[arg];
+		}
+		else
+		{
+			displayUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	query.remaining = query.count;
 
 	// Start by getting an interface with IOKit
 	const mach_port_t ioKitPort = openIOKitInterface();
 	if (ioKitPort == MACH_PORT_NULL)
 		return 1;
 
+	// If we're to watch for probes coming and going, hand off to the hotplug event loop
+	if (watch)
+	{
+		watchState_s state = {.query = &query, .fields = &fields};
+		const int result = watchProbes(ioKitPort, &state);
+		mach_port_deallocate(mach_task_self(), ioKitPort);
+		return result;
+	}
+
 	// Now try to get an iterator for all available BMPs on the syste
 	const io_iterator_t deviceIterator = discoverProbes(ioKitPort);
 	mach_port_deallocate(mach_task_self(), ioKitPort);
@@ -236,65 +827,32 @@ int main(int argc, char **argv)
 	}
 
 	// Loop through all the devices matched, poking them one at a time
+	size_t failures = 0U;
 	for (; IOIteratorIsValid(deviceIterator); )
 	{
-		IOUSBDeviceInterface **const usbDevice = openDevice(IOIteratorNext(deviceIterator));
-		if (usbDevice == NULL)
+		const io_service_t usbDeviceService = IOIteratorNext(deviceIterator);
+		if (usbDeviceService == MACH_PORT_NULL)
 			break;
 
-		// Check that the VID:PID for the device are correct
-		uint16_t vid;
-		(*usbDevice)->GetDeviceVendor(usbDevice, &vid);
-		uint16_t pid;
-		(*usbDevice)->GetDeviceProduct(usbDevice, &pid);
-		if (vid != bmdVID || pid != bmdPID)
-		{
-			// Release the device and go to the next one
-			(*usbDevice)->Release(usbDevice);
-			break;
-		}
-
-		// Get the device's address information and string descriptor indexes
-		USBDeviceAddress busAddress;
-		checkResult((*usbDevice)->GetDeviceAddress(usbDevice, &busAddress), "grabbing device address");
-		uint8_t manufacturerStringIndex;
-		checkResult((*usbDevice)->USBGetManufacturerStringIndex(usbDevice, &manufacturerStringIndex), "grabbing manufacturer string index");
-		uint8_t productStringIndex;
-		checkResult((*usbDevice)->USBGetProductStringIndex(usbDevice, &productStringIndex), "grabbing product string index");
-		uint8_t serialNumberStringIndex;
-		checkResult((*usbDevice)->USBGetSerialNumberStringIndex(usbDevice, &serialNumberStringIndex), "grabbing serial number string index");
-
-		// Open the device so we can make a few requests
-		checkResult((*usbDevice)->USBDeviceOpen(usbDevice), "opening USB device");
-
-		// Now extract the strings associated with those descriptors so we can display a nice entry for the device
-		const char *const manufacturer = requestStringFromDevice(usbDevice, manufacturerStringIndex);
-		const char *const product = requestStringFromDevice(usbDevice, productStringIndex);
-		const char *const serialNumber = requestStringFromDevice(usbDevice, serialNumberStringIndex);
-
-		// Now we're done with the requests, close the device again
-		checkResult((*usbDevice)->USBDeviceClose(usbDevice), "closing USB device");
-
-		// Check if we managed to get something for each of them, or if an error occured
-		if (manufacturer == NULL || product == NULL || serialNumber == NULL)
-		{
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wcast-qual"
-			free((void *)manufacturer);
-			free((void *)product);
-			free((void *)serialNumber);
-#pragma GCC diagnostic pop
-			printf("Failed to retreive one of the string descriptors for the device at address %u\n", busAddress);
-			// Release the device and go to the next one
-			(*usbDevice)->Release(usbDevice);
-			break;
-		}
-
-		printf("Found %s (%s) w/ serial %s at address %u\n", product, manufacturer, serialNumber, busAddress);
-
-		// Finish up by releasing the device
-		(*usbDevice)->Release(usbDevice);
+		const probeStatus_e status = displayProbe(usbDeviceService, &query, &fields, NULL, false);
+		// If something went wrong with this device, count it and carry on with the rest
+		if (status == PROBE_FAILED)
+			++failures;
+		// If that was the last of the probes we were looking for, we're done and needn't look at any of the rest
+		else if (status == PROBE_DISPLAYED && query.count != 0U && query.remaining == 0U)
+			return 0;
 	}
 
-	return 0;
+	// If we get here while looking for specific probes, some of them weren't on the system - or may have been
+	// one of the probes we failed to query, in which case we can't say they're absent
+	for (size_t index = 0U; index < query.count; ++index)
+	{
+		if (query.found[index])
+			continue;
+		if (failures != 0U)
+			printf("No BMP with serial %s found, but %zu probe(s) could not be queried\n", query.serials[index], failures);
+		else
+			printf("No BMP with serial %s found on system\n", query.serials[index]);
+	}
+	return query.remaining != 0U || failures != 0U ? 1 : 0;
 }
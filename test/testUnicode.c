@@ -0,0 +1,219 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// SPDX-FileCopyrightText: 2024 1BitSquared <info@1bitsquared.com>
+// SPDX-FileContributor: Written by Rachel Mant <git@dragonmux.network>
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "unicode.h"
+
+static size_t failures = 0U;
+
+static void check(const bool condition, const char *const description)
+{
+	if (!condition)
+	{
+		printf("FAIL: %s\n", description);
+		++failures;
+	}
+}
+
+static size_t encodeUtf8(const uint32_t codePoint, char *const string)
+{
+	// Reference UTF-8 encoder, kept deliberately simple so it's obviously right
+	if (codePoint <= 0x7fU)
+	{
+		string[0U] = (char)codePoint;
+		return 1U;
+	}
+	if (codePoint <= 0x7ffU)
+	{
+		string[0U] = (char)(0xc0U | (codePoint >> 6U));
+		string[1U] = (char)(0x80U | (codePoint & 0x3fU));
+		return 2U;
+	}
+	if (codePoint <= 0xffffU)
+	{
+		string[0U] = (char)(0xe0U | (codePoint >> 12U));
+		string[1U] = (char)(0x80U | ((codePoint >> 6U) & 0x3fU));
+		string[2U] = (char)(0x80U | (codePoint & 0x3fU));
+		return 3U;
+	}
+	string[0U] = (char)(0xf0U | (codePoint >> 18U));
+	string[1U] = (char)(0x80U | ((codePoint >> 12U) & 0x3fU));
+	string[2U] = (char)(0x80U | ((codePoint >> 6U) & 0x3fU));
+	string[3U] = (char)(0x80U | (codePoint & 0x3fU));
+	return 4U;
+}
+
+static size_t encodeUtf16(const uint32_t codePoint, char16_t *const string)
+{
+	// Reference UTF-16 encoder
+	if (codePoint <= 0xffffU)
+	{
+		string[0U] = (char16_t)codePoint;
+		return 1U;
+	}
+	const uint32_t value = codePoint - 0x10000U;
+	string[0U] = (char16_t)(0xd800U | (value >> 10U));
+	string[1U] = (char16_t)(0xdc00U | (value & 0x3ffU));
+	return 2U;
+}
+
+static bool roundTrip(const char *const utf8String, const size_t utf8Length)
+{
+	// Convert to UTF-16 and back, checking we get exactly what we started with
+	char16_t utf16String[256U];
+	const size_t utf16Length = utf16FromUtf8(utf8String, utf8Length, utf16String, 256U);
+	if (!utf16Length)
+		return false;
+	char *const result = utf8FromUtf16(utf16String, utf16Length);
+	const bool matched = result != NULL && memcmp(result, utf8String, utf8Length) == 0;
+	free(result);
+	return matched;
+}
+
+static void testScalarValues(void)
+{
+	// Check every Unicode scalar value converts to the right UTF-16 and back again
+	size_t mismatches = 0U;
+	for (uint32_t codePoint = 0U; codePoint <= 0x10ffffU; ++codePoint)
+	{
+		// Skip the surrogates as they aren't scalar values
+		if (codePoint == 0xd800U)
+			codePoint = 0xe000U;
+		char utf8String[4U];
+		const size_t utf8Length = encodeUtf8(codePoint, utf8String);
+		char16_t expected[2U];
+		const size_t expectedLength = encodeUtf16(codePoint, expected);
+
+		char16_t utf16String[2U];
+		const size_t utf16Length = utf16FromUtf8(utf8String, utf8Length, utf16String, 2U);
+		if (utf16Length != expectedLength || memcmp(utf16String, expected, expectedLength * sizeof(char16_t)) != 0)
+		{
+			++mismatches;
+			continue;
+		}
+		char *const result = utf8FromUtf16(utf16String, utf16Length);
+		if (result == NULL || memcmp(result, utf8String, utf8Length) != 0)
+			++mismatches;
+		free(result);
+	}
+	check(mismatches == 0U, "every scalar value round trips");
+}
+
+static void testASCIIBlocks(void)
+{
+	// Build a string long enough to go through the block fast path several times over
+	char string[200U];
+	for (size_t index = 0U; index < sizeof(string); ++index)
+		string[index] = (char)(index & 0x7fU);
+	for (size_t length = 0U; length <= sizeof(string); length += 7U)
+		check(length == 0U || roundTrip(string, length), "ASCII strings round trip");
+
+	// Now place a multi-byte character at every offset across the first few blocks
+	for (size_t offset = 0U; offset < 48U; ++offset)
+	{
+		char mixed[64U];
+		memset(mixed, 'a', sizeof(mixed));
+		mixed[offset] = (char)0xc3U;
+		mixed[offset + 1U] = (char)0xa9U;
+		check(roundTrip(mixed, sizeof(mixed)), "multi-byte character at any offset round trips");
+	}
+}
+
+static void testRejection(void)
+{
+	static const struct
+	{
+		const char *string;
+		const char *description;
+	} invalid[] =
+	{
+		{"\x80", "stray continuation byte is rejected"},
+		{"abc\xbf", "stray continuation byte after ASCII is rejected"},
+		{"\xc3", "truncated 2 byte sequence is rejected"},
+		{"\xe2\x82", "truncated 3 byte sequence is rejected"},
+		{"\xf0\x9f\x98", "truncated 4 byte sequence is rejected"},
+		{"\xe2" "a", "bad continuation byte is rejected"},
+		{"\xc0\x80", "overlong 2 byte form is rejected"},
+		{"\xc1\xbf", "overlong 2 byte form is rejected"},
+		{"\xe0\x9f\xbf", "overlong 3 byte form is rejected"},
+		{"\xf0\x8f\xbf\xbf", "overlong 4 byte form is rejected"},
+		{"\xed\xa0\x80", "encoded high surrogate is rejected"},
+		{"\xed\xbf\xbf", "encoded low surrogate is rejected"},
+		{"\xf4\x90\x80\x80", "value above U+10FFFF is rejected"},
+		{"\xf8\x88\x80\x80\x80", "5 byte form is rejected"},
+		{"\xff", "invalid lead byte is rejected"},
+	};
+	for (size_t index = 0U; index < sizeof(invalid) / sizeof(*invalid); ++index)
+	{
+		char16_t utf16String[16U];
+		check(utf16FromUtf8(invalid[index].string, strlen(invalid[index].string), utf16String, 16U) == 0U,
+			invalid[index].description);
+	}
+}
+
+static void testOutputSize(void)
+{
+	char string[33U];
+	memset(string, 'x', sizeof(string));
+	char16_t utf16String[32U];
+	// Exactly one block into exactly one block's worth of space fits
+	check(utf16FromUtf8(string, 16U, utf16String, 16U) == 16U, "16 units fit in 16 units");
+	// One more byte than that doesn't, nor do two whole blocks
+	check(utf16FromUtf8(string, 17U, utf16String, 16U) == 0U, "17 units don't fit in 16 units");
+	check(utf16FromUtf8(string, 32U, utf16String, 16U) == 0U, "32 units don't fit in 16 units");
+	// A character that needs a surrogate pair after a full block doesn't fit in one unit of space
+	memcpy(string + 16U, "\xf0\x9f\x98\x80", 4U);
+	check(utf16FromUtf8(string, 20U, utf16String, 17U) == 0U, "surrogate pair doesn't fit in 1 unit");
+	check(utf16FromUtf8(string, 20U, utf16String, 18U) == 18U, "surrogate pair fits in 2 units");
+}
+
+static void testBatch(void)
+{
+	static const char16_t first[] = {'B', 'M', 'P'};
+	static const char16_t unpaired[] = {'a', 0xdc00U};
+	static const char16_t second[] = {0x00e9U, 0xd83dU, 0xde00U};
+	const utf16Span_s inputs[] =
+	{
+		{first, 3U},
+		{unpaired, 2U},
+		{NULL, 0U},
+		{second, 3U},
+	};
+	utf8Span_s outputs[4U];
+	char *arena = NULL;
+	check(utf8FromUtf16Batch(inputs, 4U, outputs, &arena) && arena != NULL, "batch conversion succeeds");
+	if (arena == NULL)
+		return;
+	// Valid strings are laid out back-to-back, empty ones take no space, and invalid ones are marked as such
+	check(outputs[0U].offset == 0U && outputs[0U].length == 3U && memcmp(arena, "BMP", 3U) == 0,
+		"first batch string converted");
+	check(outputs[1U].length == UTF8_SPAN_INVALID, "invalid batch string marked invalid");
+	check(outputs[2U].length == 0U, "empty batch string is empty, not invalid");
+	check(outputs[3U].offset == 3U && outputs[3U].length == 6U &&
+		memcmp(arena + 3U, "\xc3\xa9\xf0\x9f\x98\x80", 6U) == 0, "second batch string converted");
+	free(arena);
+
+	// A batch with nothing to store succeeds without an arena
+	arena = (char *)1;
+	check(utf8FromUtf16Batch(inputs + 1U, 2U, outputs, &arena) && arena == NULL, "empty batch succeeds");
+	check(utf8FromUtf16Batch(inputs, 0U, outputs, &arena) && arena == NULL, "zero length batch succeeds");
+}
+
+int main(void)
+{
+	testScalarValues();
+	testASCIIBlocks();
+	testRejection();
+	testOutputSize();
+	testBatch();
+	if (failures)
+		printf("%zu checks failed\n", failures);
+	return failures ? 1 : 0;
+}
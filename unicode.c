@@ -4,8 +4,14 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#if defined(__SSE2__) && !defined(UNICODE_NO_SIMD)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__) && !defined(UNICODE_NO_SIMD)
+#include <arm_neon.h>
+#endif
 #include "unicode.h"
 
 static inline uint16_t safeIndex(const char16_t *const string, const size_t index, const size_t length)
@@ -24,18 +30,18 @@ static size_t countUnits(const char16_t *const string, const size_t length)
 		// Grab the next code unit
 		const uint16_t uintA = safeIndex(string, offset, length);
 		// Check if it's a valid high surrogate (start of a surrogate pair)
-		if ((uintA & 0xfe00U) == 0xd800U)
+		if ((uintA & 0xfc00U) == 0xd800U)
 		{
 			// If we got one, get the next code unit
 			const uint16_t uintB = safeIndex(string, ++offset, length);
 			// Validate that it's a valid low surrogate, and if not bail
-			if ((uintB & 0xfe00U) != 0xdc00U)
+			if ((uintB & 0xfc00U) != 0xdc00U)
 				return 0U;
 			// The character needs 3 additional bytes for a total of 4
 			count += 3U;
 		}
 		// Check if it's a low surrogate (unpaired) and if so, bair
-		else if ((uintA & 0xfe00U) == 0xdc00U)
+		else if ((uintA & 0xfc00U) == 0xdc00U)
 			return 0U;
 		else
 		{
@@ -52,28 +58,20 @@ static size_t countUnits(const char16_t *const string, const size_t length)
 	return count;
 }
 
-char *utf8FromUtf16(const char16_t *const utf16String, const size_t utf16Length)
+static void encodeUnits(const char16_t *const utf16String, const size_t utf16Length, char *const result)
 {
-	// Figure out how long the UTF-8 string equivilent of the UTF-16 string is exactly
-	const size_t utf8Length = countUnits(utf16String, utf16Length);
-	if (!utf8Length)
-		return NULL;
-	// Try to allocate storage for the new string
-	char *const result = malloc(utf8Length);
-	if (!result)
-		return NULL;
 	// Loop through all the code units on the input string
 	for (size_t inputOffset = 0U, outputOffset = 0U; inputOffset < utf16Length; ++inputOffset, ++outputOffset)
 	{
 		// Extract a code unit
 		const uint16_t uintA = safeIndex(utf16String, inputOffset, utf16Length);
 		// Handle if it's a surrogate pair (already validated whole in countUnits())
-		if ((uintA & 0xfe00U) == 0xd800U)
+		if ((uintA & 0xfc00U) == 0xd800U)
 		{
 			// Recover the upper 10 (11) bits from the first surrogate in the pair
 			const uint16_t upper = (uintA & 0x03ffU) + 0x0040U;
 			// Recover the lower 10 bits from the second surrogate of the pair
-			const uint16_t lower = safeIndex(utf16String, ++inputOffset, utf8Length) & 0x3ffU;
+			const uint16_t lower = safeIndex(utf16String, ++inputOffset, utf16Length) & 0x3ffU;
 
 			// Now encode the entire thing as a 4 byte sequence
 			result[outputOffset + 0] = (char)(0xf0U | ((uint8_t)(upper >> 8U) & 0x07U));
@@ -104,5 +102,197 @@ char *utf8FromUtf16(const char16_t *const utf16String, const size_t utf16Length)
 			}
 		}
 	}
+}
+
+char *utf8FromUtf16(const char16_t *const utf16String, const size_t utf16Length)
+{
+	// Figure out how long the UTF-8 string equivilent of the UTF-16 string is exactly
+	const size_t utf8Length = countUnits(utf16String, utf16Length);
+	if (!utf8Length)
+		return NULL;
+	// Try to allocate storage for the new string
+	char *const result = malloc(utf8Length);
+	if (!result)
+		return NULL;
+	// Convert the string into the new storage
+	encodeUnits(utf16String, utf16Length, result);
 	return result;
 }
+
+size_t utf8FromUtf16Buffer(const char16_t *const utf16String, const size_t utf16Length, char *const utf8String,
+	const size_t utf8Length)
+{
+	// Figure out how long the UTF-8 string equivilent of the UTF-16 string is exactly, and check it fits
+	const size_t length = countUnits(utf16String, utf16Length);
+	if (!length || length > utf8Length)
+		return 0U;
+	// Convert the string into the caller's storage
+	encodeUnits(utf16String, utf16Length, utf8String);
+	return length;
+}
+
+bool utf8FromUtf16Batch(const utf16Span_s *const inputs, const size_t count, utf8Span_s *const outputs,
+	char **const arena)
+{
+	*arena = NULL;
+	// Validate every string and lay out where each one goes in the arena, working out the total size as we go
+	size_t arenaLength = 0U;
+	for (size_t index = 0U; index < count; ++index)
+	{
+		outputs[index].offset = arenaLength;
+		// Empty strings are valid and take up no space in the arena
+		if (!inputs[index].length)
+		{
+			outputs[index].length = 0U;
+			continue;
+		}
+		// Invalid strings get marked as such and take up no space either
+		const size_t utf8Length = countUnits(inputs[index].string, inputs[index].length);
+		if (!utf8Length)
+		{
+			outputs[index].length = UTF8_SPAN_INVALID;
+			continue;
+		}
+		// Make sure the arena's total size can't overflow
+		if (utf8Length > SIZE_MAX - arenaLength)
+			return false;
+		outputs[index].length = utf8Length;
+		arenaLength += utf8Length;
+	}
+	// If there's nothing to store, we're done
+	if (!arenaLength)
+		return true;
+
+	// Try to allocate a single block of storage for all the new strings
+	*arena = malloc(arenaLength);
+	if (!*arena)
+		return false;
+	// Now convert each of the valid strings into their places in the arena
+	for (size_t index = 0U; index < count; ++index)
+	{
+		if (outputs[index].length && outputs[index].length != UTF8_SPAN_INVALID)
+			encodeUnits(inputs[index].string, inputs[index].length, *arena + outputs[index].offset);
+	}
+	return true;
+}
+
+static size_t widenASCII(const char *const utf8String, const size_t utf8Length, char16_t *const utf16String,
+	const size_t utf16Length)
+{
+	// Work out how many whole 16 byte blocks we can process, limited by both the input and output lengths
+	const size_t length = (utf8Length < utf16Length ? utf8Length : utf16Length) & ~(size_t)15U;
+	size_t offset = 0U;
+#if defined(__SSE2__) && !defined(UNICODE_NO_SIMD)
+	const __m128i zero = _mm_setzero_si128();
+	for (; offset < length; offset += 16U)
+	{
+		// Grab the next block of bytes and check they're all ASCII (top bit clear), stopping if not
+		const __m128i block = _mm_loadu_si128((const void *)(utf8String + offset));
+		if (_mm_movemask_epi8(block))
+			break;
+		// Widen the bytes to code units by interleaving them with 0's
+		_mm_storeu_si128((void *)(utf16String + offset), _mm_unpacklo_epi8(block, zero));
+		_mm_storeu_si128((void *)(utf16String + offset + 8U), _mm_unpackhi_epi8(block, zero));
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__) && !defined(UNICODE_NO_SIMD)
+	for (; offset < length; offset += 16U)
+	{
+		// Grab the next block of bytes and check they're all ASCII (top bit clear), stopping if not
+		const uint8x16_t block = vld1q_u8((const uint8_t *)(utf8String + offset));
+		if (vmaxvq_u8(block) & 0x80U)
+			break;
+		// Widen the bytes to code units by zero extending them
+		vst1q_u16(utf16String + offset, vmovl_u8(vget_low_u8(block)));
+		vst1q_u16(utf16String + offset + 8U, vmovl_high_u8(block));
+	}
+#else
+	// No vector unit to speak of, so leave everything to the scalar path
+	(void)utf8String;
+	(void)utf16String;
+	(void)length;
+#endif
+	return offset;
+}
+
+size_t utf16FromUtf8(const char *const utf8String, const size_t utf8Length, char16_t *const utf16String,
+	const size_t utf16Length)
+{
+	// The smallest valid code point for each sequence length, used to reject overlong encodings
+	static const uint32_t minimumCodePoint[5U] = {0U, 0U, 0x00000080U, 0x00000800U, 0x00010000U};
+
+	size_t inputOffset = 0U;
+	size_t outputOffset = 0U;
+	while (inputOffset < utf8Length)
+	{
+		// Run as much of the string through the ASCII fast path as we can
+		const size_t widened = widenASCII(utf8String + inputOffset, utf8Length - inputOffset,
+			utf16String + outputOffset, utf16Length - outputOffset);
+		inputOffset += widened;
+		outputOffset += widened;
+		if (inputOffset == utf8Length)
+			break;
+
+		// Extract the lead byte of the next sequence and figure out how long the sequence is from it
+		const uint8_t leadByte = (uint8_t)utf8String[inputOffset];
+		uint32_t codePoint = 0U;
+		size_t sequenceLength = 0U;
+		if (leadByte <= 0x7fU)
+		{
+			codePoint = leadByte;
+			sequenceLength = 1U;
+		}
+		else if ((leadByte & 0xe0U) == 0xc0U)
+		{
+			codePoint = leadByte & 0x1fU;
+			sequenceLength = 2U;
+		}
+		else if ((leadByte & 0xf0U) == 0xe0U)
+		{
+			codePoint = leadByte & 0x0fU;
+			sequenceLength = 3U;
+		}
+		else if ((leadByte & 0xf8U) == 0xf0U)
+		{
+			codePoint = leadByte & 0x07U;
+			sequenceLength = 4U;
+		}
+		// It's a stray continuation byte or otherwise invalid, so bail
+		else
+			return 0U;
+		// Check the whole sequence is present, and bail if it's truncated
+		if (sequenceLength > utf8Length - inputOffset)
+			return 0U;
+
+		// Accumulate the rest of the code point from the continuation bytes, validating each as we go
+		for (size_t byte = 1U; byte < sequenceLength; ++byte)
+		{
+			const uint8_t continuation = (uint8_t)utf8String[inputOffset + byte];
+			if ((continuation & 0xc0U) != 0x80U)
+				return 0U;
+			codePoint = (codePoint << 6U) | (continuation & 0x3fU);
+		}
+		// Reject overlong encodings, encoded surrogates, and anything beyond the end of Unicode
+		if (codePoint < minimumCodePoint[sequenceLength] || (codePoint & 0xfffff800U) == 0xd800U ||
+			codePoint > 0x10ffffU)
+			return 0U;
+		inputOffset += sequenceLength;
+
+		// If it fits in a single code unit, store it as-is
+		if (codePoint <= 0xffffU)
+		{
+			if (outputOffset >= utf16Length)
+				return 0U;
+			utf16String[outputOffset++] = (char16_t)codePoint;
+		}
+		// Otherwise encode it as a surrogate pair
+		else
+		{
+			if (utf16Length - outputOffset < 2U)
+				return 0U;
+			codePoint -= 0x00010000U;
+			utf16String[outputOffset++] = (char16_t)(0xd800U | (codePoint >> 10U));
+			utf16String[outputOffset++] = (char16_t)(0xdc00U | (codePoint & 0x03ffU));
+		}
+	}
+	return outputOffset;
+}
@@ -7,9 +7,35 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
 typedef uint16_t char16_t;
 
+typedef struct utf16Span
+{
+	const char16_t *string;
+	size_t length;
+} utf16Span_s;
+
+typedef struct utf8Span
+{
+	size_t offset;
+	size_t length;
+} utf8Span_s;
+
+// The length recorded in a utf8Span_s for an input string that is not valid UTF-16
+#define UTF8_SPAN_INVALID SIZE_MAX
+
 char *utf8FromUtf16(const char16_t *utf16String, size_t utf16Length);
+// Converts into a caller-supplied buffer, returning the number of bytes written, or 0 if the input is empty, invalid,
+// or doesn't fit
+size_t utf8FromUtf16Buffer(const char16_t *utf16String, size_t utf16Length, char *utf8String, size_t utf8Length);
+// Converts many strings at once, back-to-back into a single allocation returned in *arena (NULL if there was nothing
+// to store), with outputs[n] locating string n in it. Returns false only if the total size overflows or the
+// allocation could not be made
+bool utf8FromUtf16Batch(const utf16Span_s *inputs, size_t count, utf8Span_s *outputs, char **arena);
+// Converts into a caller-supplied buffer (needing at most utf8Length code units), returning the number of code units
+// written, or 0 if the input is empty, invalid, or doesn't fit
+size_t utf16FromUtf8(const char *utf8String, size_t utf8Length, char16_t *utf16String, size_t utf16Length);
 
 #endif /*UNICODE_H*/